@@ -0,0 +1,108 @@
+#include "analysis.h"
+
+#include <chrono>
+
+#include "search-cache.h"
+
+bool movesFromString(const std::string &digits, std::vector<int> &moves) {
+    moves.clear();
+    for (char c : digits) {
+        if (c < '0' || c > '6') {
+            return false;
+        }
+        moves.push_back(c - '0');
+    }
+    return true;
+}
+
+// Each CFEF has to follow from the one before it by a single move of the side
+// to move.
+bool movesFromCfefs(const std::vector<std::string> &cfefs, std::vector<int> &moves) {
+    moves.clear();
+    for (size_t i = 1; i < cfefs.size(); i++) {
+        Board before = Board::fromCfef(cfefs[i - 1]);
+        Board after = Board::fromCfef(cfefs[i]);
+        uint64_t added = (after.pieces[0] | after.pieces[1]) ^ (before.pieces[0] | before.pieces[1]);
+        if (__builtin_popcountll(added) != 1) {
+            return false;
+        }
+        int cIdx = __builtin_ctzll(added) / 6;
+        if (!before.canPlay(cIdx) || !(before.forMove(cIdx) == after)) {
+            return false;
+        }
+        moves.push_back(cIdx);
+    }
+    return true;
+}
+
+GameAnalysis analyzeGame(const Board &start, const std::vector<int> &moves, uint32_t maxDepth, SearchCache &cache) {
+    GameAnalysis analysis;
+    // A search to depth 0 has no moves to compare.
+    if (maxDepth == 0) {
+        return analysis;
+    }
+
+    std::vector<Board> boards = {start};
+    for (size_t i = 0; i < moves.size(); i++) {
+        // A copy: the push_back below may move the vector's storage.
+        Board board = boards.back();
+        bool over = boards.size() > 1 && boards[boards.size() - 2].doesMoveWin(moves[i - 1]);
+        if (over || !board.canPlay(moves[i])) {
+            analysis.illegalMove = i;
+            break;
+        }
+        boards.push_back(board.forMove(moves[i]));
+    }
+
+    std::vector<PlyAnalysis> &plies = analysis.plies;
+    plies.resize(boards.size() - 1);
+
+    // Runs of plies search to one shared horizon. A new run starts maxDepth
+    // plies ahead of the first ply that would be left less than half as deep.
+    uint32_t minDepth = std::max<uint32_t>((maxDepth + 1) / 2, 1);
+    std::vector<uint32_t> depths(plies.size());
+    uint32_t horizon = 0;
+    for (size_t i = 0; i < plies.size(); i++) {
+        uint32_t turn = boards[i].turnCount();
+        if (horizon < turn + minDepth) {
+            horizon = std::min<uint32_t>(turn + maxDepth, 42);
+        }
+        depths[i] = horizon - turn;
+    }
+
+    for (size_t i = plies.size(); i-- > 0;) {
+        const Board &board = boards[i];
+        int move = moves[i];
+        uint32_t depth = depths[i];
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        // The played move's value comes from the same search, unless an
+        // earlier column won on the spot and the rest were never searched.
+        // A move that wins ends the game, so there is no reply to search.
+        std::array<EvaluationPart, 7> childValues;
+        Evaluation best = board.evaluate(depth, &cache, &childValues);
+        EvaluationPart playedValue = childValues[move];
+        if (board.doesMoveWin(move)) {
+            playedValue = EvaluationPart(1, 1);
+        } else if (playedValue.score == -2 && depth > 1) {
+            Evaluation reply = boards[i + 1].evaluate(depth - 1, &cache);
+            playedValue = EvaluationPart(-reply.score, reply.winIn + 1);
+        } else if (playedValue.score == -2) {
+            playedValue = EvaluationPart(0, 1);
+        }
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+
+        PlyAnalysis &ply = plies[i];
+        ply.ply = board.turnCount();
+        ply.cfef = board.toCfef();
+        ply.played = move;
+        ply.depth = depth;
+        ply.best = best;
+        ply.playedValue = playedValue;
+        ply.swing = best.score - playedValue.score;
+        ply.micros = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
+    }
+    return analysis;
+}
@@ -0,0 +1,48 @@
+#ifndef CONNECT_FOUR_ANALYSIS_H
+#define CONNECT_FOUR_ANALYSIS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "connect-four.h"
+
+class SearchCache;
+
+// Per-ply audit of a finished game. Runs of consecutive plies are searched to
+// one shared horizon, from the last ply of the game backwards through one
+// SearchCache. The position after each played move then sits in the cache
+// searched to exactly the horizon, so its whole subtree costs one lookup and
+// a run costs about one search of its first ply. A ply is searched maxDepth
+// plies deep at the start of a run and no less than half that at its end.
+// The played move's value comes out of the same search as the best move's.
+
+// Holds every entry of depth 4 or more that a depth 12 analysis of a full
+// game records; deeper analyses fall back on the cache's replacement.
+const uint64_t ANALYSIS_CACHE_CAPACITY = 1u << 21u;
+const uint32_t ANALYSIS_CACHE_MIN_DEPTH = 4;
+
+struct PlyAnalysis {
+    int ply;
+    std::string cfef;
+    int played;
+    uint32_t depth;
+    Evaluation best;
+    EvaluationPart playedValue;
+    int swing;
+    uint64_t micros;
+};
+
+struct GameAnalysis {
+    std::vector<PlyAnalysis> plies;
+    // Index of the first move that could not be played, because its column
+    // was full or the game was already won, or -1 if every move was played.
+    int illegalMove = -1;
+};
+
+bool movesFromString(const std::string &digits, std::vector<int> &moves);
+bool movesFromCfefs(const std::vector<std::string> &cfefs, std::vector<int> &moves);
+
+GameAnalysis analyzeGame(const Board &start, const std::vector<int> &moves, uint32_t maxDepth, SearchCache &cache);
+
+#endif //CONNECT_FOUR_ANALYSIS_H
@@ -2,8 +2,11 @@
 // Created by Keegan Millard on 2020-07-08.
 //
 
-#include <c++/4.8.3/chrono>
+#include <algorithm>
+#include <chrono>
 #include "connect-four.h"
+#include "search-cache.h"
+#include "threat-space.h"
 
 
 // Bit Manipulation
@@ -33,6 +36,15 @@ uint64_t getCol(uint64_t pieces, uint32_t cIdx) {
     return (pieces >> (cIdx * 6)) & 0x3Fu;
 }
 
+uint64_t playableMask(uint64_t combinedPieces) {
+    uint64_t ret = 0;
+    for (uint32_t cIdx = 0; cIdx < 7; cIdx++) {
+        uint64_t col = getCol(combinedPieces, cIdx) | 0b1000000u;
+        ret |= ((col & -col) >> 1u) << (cIdx * 6);
+    }
+    return ret;
+}
+
 // Connect Four Checks
 
 bool upDiagHelper(uint64_t pieces, uint32_t offset, uint64_t mask) {
@@ -116,6 +128,44 @@ bool connectedFour(uint64_t pieces, uint32_t rIdx, uint32_t cIdx) {
         dnDiagConnectsFour(pieces, rIdx, cIdx);
 }
 
+// Threat Masks
+
+std::array<uint64_t, 69> makeWinLines() {
+    std::array<uint64_t, 69> lines{};
+    int idx = 0;
+    for (int cIdx = 0; cIdx < 7; cIdx++) {
+        for (int rIdx = 0; rIdx < 6; rIdx++) {
+            const int dirs[4][2] = {{1, 0}, {0, 1}, {1, 1}, {-1, 1}};
+            for (auto dir : dirs) {
+                int rEnd = rIdx + dir[0] * 3;
+                int cEnd = cIdx + dir[1] * 3;
+                if (rEnd < 0 || rEnd > 5 || cEnd > 6) {
+                    continue;
+                }
+                uint64_t line = 0;
+                for (int i = 0; i < 4; i++) {
+                    setBitAtPos(line, rIdx + dir[0] * i, cIdx + dir[1] * i);
+                }
+                lines[idx++] = line;
+            }
+        }
+    }
+    return lines;
+}
+
+static const std::array<uint64_t, 69> WIN_LINES = makeWinLines();
+
+uint64_t threatMask(uint64_t pieces, uint64_t combinedPieces) {
+    uint64_t ret = 0;
+    for (uint64_t line : WIN_LINES) {
+        uint64_t missing = line & ~pieces;
+        if ((missing & (missing - 1)) == 0 && (missing & combinedPieces) == 0) {
+            ret |= missing;
+        }
+    }
+    return ret;
+}
+
 // evaluation
 
 
@@ -159,7 +209,7 @@ Board Board::fromCfef(const std::string &cfef) {
 std::string Board::toCfef() const {
     std::string cfefOut;
     for (uint32_t cIdx = 0; cIdx < 7; cIdx++) {
-        for (uint32_t rIdx = 5; rIdx >= 0; rIdx--) {
+        for (int rIdx = 5; rIdx >= 0; rIdx--) {
 
             if (getBitAtPos(pieces[0], rIdx, cIdx)) {
                 cfefOut += PLAYER_1;
@@ -221,13 +271,18 @@ bool isBetter(const EvaluationPart &p1, const EvaluationPart &p2) {
     }
 }
 
-EvaluationPart evaluateHelper(uint64_t piecesTurn, uint64_t piecesOther, int depthRem) {
+// Past the hashed plies the only thing cache is asked for is the tablebase.
+EvaluationPart evaluateHelper(uint64_t piecesTurn, uint64_t piecesOther, int depthRem, SearchCache *cache) {
     if (depthRem == 0) {
         leafNodesReached++;
         return {0,0};
     }
 
     uint64_t  combinedPieces = piecesTurn | piecesOther;
+    EvaluationPart cached;
+    if (cache != nullptr && cache->inTablebaseRange(combinedPieces) && cache->probeTablebase(piecesTurn, piecesOther, depthRem, cached)) {
+        return cached;
+    }
     EvaluationPart best(-2, 0);
 
     for (uint32_t cIdx = 0; cIdx < 7; cIdx++) {
@@ -241,7 +296,7 @@ EvaluationPart evaluateHelper(uint64_t piecesTurn, uint64_t piecesOther, int dep
         if (connectedFour(piecesTurnAfter, rIdx, cIdx)) {
             return {1,1};
         }
-        auto res = evaluateHelper(piecesOther, piecesTurnAfter, depthRem-1);
+        auto res = evaluateHelper(piecesOther, piecesTurnAfter, depthRem-1, cache);
         res.winIn++;
         res.score *= -1;
         if (isBetter(res, best)) {
@@ -252,13 +307,18 @@ EvaluationPart evaluateHelper(uint64_t piecesTurn, uint64_t piecesOther, int dep
     return best;
 }
 
-EvaluationPart evaluateHelperHashed(const uint64_t piecesTurn, const uint64_t piecesOther, const int depthRem, const uint32_t hashDepth, const int hashDepthRem, MultiHashMap<EvaluationPart> &table) {
+EvaluationPart evaluateHelperHashed(const uint64_t piecesTurn, const uint64_t piecesOther, const int depthRem, const uint32_t hashDepth, const int hashDepthRem, MultiHashMap<EvaluationPart> &table, SearchCache *cache) {
     if (depthRem == 0) {
         return {0,0};
     }
 
     if (hashDepthRem == 0) {
-        return evaluateHelper(piecesTurn, piecesOther, depthRem);
+        return evaluateHelper(piecesTurn, piecesOther, depthRem, cache);
+    }
+
+    EvaluationPart cached;
+    if (cache != nullptr && cache->inTablebaseRange(piecesTurn | piecesOther) && cache->probeTablebase(piecesTurn, piecesOther, depthRem, cached)) {
+        return cached;
     }
 
     const EvaluationPart* evalPtr = table.get(piecesTurn, piecesOther);
@@ -267,6 +327,10 @@ EvaluationPart evaluateHelperHashed(const uint64_t piecesTurn, const uint64_t pi
         return *evalPtr;
     }
 
+    if (cache != nullptr && cache->probe(piecesTurn, piecesOther, depthRem, cached)) {
+        return cached;
+    }
+
     uint64_t  combinedPieces = piecesTurn | piecesOther;
     EvaluationPart best(-2, 0);
 
@@ -282,7 +346,7 @@ EvaluationPart evaluateHelperHashed(const uint64_t piecesTurn, const uint64_t pi
             best = {1,1};
             break;
         }
-        auto res = evaluateHelperHashed(piecesOther, piecesTurnAfter, depthRem-1, hashDepth+1, hashDepthRem-1, table);
+        auto res = evaluateHelperHashed(piecesOther, piecesTurnAfter, depthRem-1, hashDepth+1, hashDepthRem-1, table, cache);
         res.winIn++;
         res.score *= -1;
         if (isBetter(res, best)) {
@@ -295,11 +359,20 @@ EvaluationPart evaluateHelperHashed(const uint64_t piecesTurn, const uint64_t pi
     } else {
         connectFourHashFailedInserts++;
     }
+    if (cache != nullptr) {
+        cache->record(piecesTurn, piecesOther, best, depthRem);
+    }
     return best;
 }
 
-Evaluation Board::evaluate(uint32_t depth) const {
+// childValues, when given, gets each move's value from the side to move's
+// point of view, or {-2, 0} for moves that are not legal or were not searched
+// because an earlier one wins on the spot.
+Evaluation Board::evaluate(uint32_t depth, SearchCache *cache, std::array<EvaluationPart, 7> *childValues) const {
     MultiHashMap<EvaluationPart> table(HASH_TABLE_CAPACITY);
+    if (childValues != nullptr) {
+        childValues->fill(EvaluationPart(-2, 0));
+    }
     EvaluationPart best(-2, 0);
     int bestMove = -1;
 
@@ -318,27 +391,47 @@ Evaluation Board::evaluate(uint32_t depth) const {
         if (connectedFour(piecesTurnAfter, rIdx, cIdx)) {
             best = EvaluationPart(1, 1);
             bestMove = cIdx;
+            if (childValues != nullptr) {
+                (*childValues)[cIdx] = best;
+            }
             break;
         }
 
-        auto res = evaluateHelperHashed(piecesOther, piecesTurnAfter, depth-1, 1, HASH_TABLE_DEPTH-1, table);
+        auto res = evaluateHelperHashed(piecesOther, piecesTurnAfter, depth-1, 1, HASH_TABLE_DEPTH-1, table, cache);
         res.winIn++;
         res.score *= -1;
+        if (childValues != nullptr) {
+            (*childValues)[cIdx] = res;
+        }
         if (isBetter(res, best)) {
             best = res;
             bestMove = cIdx;
         }
     }
 
+    if (cache != nullptr) {
+        cache->record(piecesTurn, piecesOther, best, depth);
+    }
     return {best.score, bestMove, best.winIn, depth};
 }
 
+// The plain minimax with no table, kept as the yardstick for the optimized search.
+EvaluationPart evaluateReference(const Board &board, uint32_t depth) {
+    uint64_t piecesTurn = board.isP1Turn() ? board.pieces[0] : board.pieces[1];
+    uint64_t piecesOther = board.isP1Turn() ? board.pieces[1] : board.pieces[0];
+    return evaluateHelper(piecesTurn, piecesOther, depth, nullptr);
+}
+
 
 
 
 
 
-bool Board::doesMoveWin(int move) {
+bool Board::canPlay(uint32_t cIdx) const {
+    return cIdx < 7 && getOpenRowIdx(getCol(pieces[0] | pieces[1], cIdx)) >= 0;
+}
+
+bool Board::doesMoveWin(int move) const {
     int rIdx = getOpenRowIdx(getCol(pieces[0] | pieces[1], move));
     uint64_t piecesTurnAfter = getWithSetBit(isP1Turn() ? pieces[0] : pieces[1], rIdx, move);
     return connectedFour(piecesTurnAfter, rIdx, move);
@@ -374,12 +467,30 @@ void test() {
 }
 
 Evaluation evaluateDynamicDepth(const Board &board, uint64_t msAllowed) {
+    return evaluateDynamicDepth(board, msAllowed, nullptr);
+}
+
+// A chain of threats usually lies far past the depth the full-width search
+// reaches in time, and is cheap to find on its own.
+static bool threatSpaceWin(const Board &board, Evaluation &out) {
+    ThreatSpaceResult threats = threatSpaceSearch(board, 42 - board.turnCount(), THREAT_SPACE_NODE_BUDGET);
+    if (threats.proven) {
+        out = Evaluation(1, threats.line.front(), threats.winIn, threats.winIn);
+    }
+    return threats.proven;
+}
+
+Evaluation evaluateDynamicDepth(const Board &board, uint64_t msAllowed, SearchCache *cache) {
+    Evaluation evaluation;
+    if (threatSpaceWin(board, evaluation)) {
+        return evaluation;
+    }
+
     int depth = 5;
     uint64_t duration = 0;
-    Evaluation evaluation;
     do {
         auto start = std::chrono::high_resolution_clock::now();
-        evaluation = board.evaluate(depth);
+        evaluation = board.evaluate(depth, cache);
         auto end = std::chrono::high_resolution_clock::now();
         duration = std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count();
         depth++;
@@ -387,6 +498,35 @@ Evaluation evaluateDynamicDepth(const Board &board, uint64_t msAllowed) {
     return evaluation;
 }
 
+// Deepens for as long as the next search is expected to finish inside
+// msAllowed, assuming it grows by as much as the last one did.
+// evaluateDynamicDepth stops far earlier, so against an engine that uses its
+// whole time it would be playing on a fraction of the clock.
+Evaluation evaluateForTime(const Board &board, uint64_t msAllowed, SearchCache *cache) {
+    Evaluation evaluation;
+    if (threatSpaceWin(board, evaluation)) {
+        return evaluation;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    double lastMicros = 0;
+    for (uint32_t depth = 1; board.turnCount() + depth <= 42; depth++) {
+        auto searchStart = std::chrono::high_resolution_clock::now();
+        evaluation = board.evaluate(depth, cache);
+        auto end = std::chrono::high_resolution_clock::now();
+        if (evaluation.score != 0) {
+            break;
+        }
+        double micros = std::chrono::duration_cast<std::chrono::microseconds>(end-searchStart).count();
+        double growth = lastMicros > 0 ? std::min(std::max(micros / lastMicros, 1.5), 8.0) : 8.0;
+        lastMicros = std::max(micros, 1.0);
+        double usedMicros = std::chrono::duration_cast<std::chrono::microseconds>(end-start).count();
+        if (usedMicros + micros * growth > msAllowed * 1000.0) {
+            break;
+        }
+    }
+    return evaluation;
+}
 
 EvaluationPart::EvaluationPart(int score, uint32_t winIn) : score(score), winIn(winIn) {}
 
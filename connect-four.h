@@ -35,12 +35,16 @@ const char PLAYER_2 = 'y';
 const int HASH_TABLE_DEPTH = 10;
 const int HASH_TABLE_CAPACITY = 50000;
 
-static int connectFourHashUses = 0;
-static int connectFourHashInserts = 0;
-static int connectFourHashFailedInserts = 0;
+const uint64_t THREAT_SPACE_NODE_BUDGET = 200000;
 
-static uint64_t connectFoursEvaluated = 0;
-static uint64_t leafNodesReached = 0;
+static thread_local int connectFourHashUses = 0;
+static thread_local int connectFourHashInserts = 0;
+static thread_local int connectFourHashFailedInserts = 0;
+
+static thread_local uint64_t connectFoursEvaluated = 0;
+static thread_local uint64_t leafNodesReached = 0;
+
+class SearchCache;
 
 struct EvaluationPart {
     int8_t score = 0;
@@ -76,12 +80,20 @@ struct Board {
 
     int turnCount() const;
     bool isP1Turn() const;
-    Evaluation evaluate(uint32_t depth) const;
-    bool doesMoveWin(int move);
+    Evaluation evaluate(uint32_t depth, SearchCache *cache = nullptr, std::array<EvaluationPart, 7> *childValues = nullptr) const;
+    bool canPlay(uint32_t cIdx) const;
+    bool doesMoveWin(int move) const;
     bool operator==(const Board &rhs) const;
 };
 
+bool isBetter(const EvaluationPart &p1, const EvaluationPart &p2);
+EvaluationPart evaluateReference(const Board &board, uint32_t depth);
+uint64_t playableMask(uint64_t combinedPieces);
+uint64_t threatMask(uint64_t pieces, uint64_t combinedPieces);
+
 Evaluation evaluateDynamicDepth(const Board &board, uint64_t msAllowed);
+Evaluation evaluateDynamicDepth(const Board &board, uint64_t msAllowed, SearchCache *cache);
+Evaluation evaluateForTime(const Board &board, uint64_t msAllowed, SearchCache *cache);
 
 void test();
 
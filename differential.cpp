@@ -0,0 +1,337 @@
+#include "differential.h"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+#include "analysis.h"
+#include "search-cache.h"
+#include "tablebase.h"
+#include "threat-space.h"
+
+// Enough for a worker to reuse results across many positions without taking
+// too much memory per thread.
+static const uint64_t DIFF_CACHE_CAPACITY = 1u << 18u;
+// Holds everything one search of a generated position records.
+static const uint64_t DIFF_SNAPSHOT_CAPACITY = 1u << 14u;
+// Positions with more empty squares than this take too long to build a
+// tablebase under.
+static const uint32_t DIFF_TABLEBASE_MAX_EMPTY = 12;
+// Analyzing a game costs about as much as checking each of its plies, so only
+// one generated game in this many is analyzed.
+static const uint64_t DIFF_ANALYSIS_INTERVAL = 32;
+
+static uint64_t splitMix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15llu;
+    x = (x ^ (x >> 30u)) * 0xBF58476D1CE4E5B9llu;
+    x = (x ^ (x >> 27u)) * 0x94D049BB133111EBllu;
+    return x ^ (x >> 31u);
+}
+
+// Replays a move list from the empty board. Fails if a move is illegal or
+// ends the game, since finished positions are not searched.
+static bool replay(const std::vector<int> &moves, Board &out) {
+    Board board({0, 0});
+    for (int move : moves) {
+        if (!board.canPlay(move) || board.doesMoveWin(move) || board.turnCount() >= 41) {
+            return false;
+        }
+        board = board.forMove(move);
+    }
+    out = board;
+    return true;
+}
+
+static bool handsOverWin(const Board &board, int move) {
+    Board after = board.forMove(move);
+    for (uint32_t cIdx = 0; cIdx < 7; cIdx++) {
+        if (after.canPlay(cIdx) && after.doesMoveWin(cIdx)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Random reachable positions. Half are uniform playouts; the other half avoid
+// giving the opponent an immediate win where they can, which keeps the
+// position tactical for longer and pushes forced results towards the horizon.
+static std::vector<int> generateMoves(std::mt19937_64 &rng) {
+    bool sharp = rng() % 2 == 0;
+    int length = rng() % 36;
+    std::vector<int> moves;
+    Board board({0, 0});
+
+    while ((int)moves.size() < length && board.turnCount() < 40) {
+        std::vector<int> candidates;
+        std::vector<int> quiet;
+        for (uint32_t cIdx = 0; cIdx < 7; cIdx++) {
+            if (!board.canPlay(cIdx) || board.doesMoveWin(cIdx)) {
+                continue;
+            }
+            candidates.push_back(cIdx);
+            if (sharp && !handsOverWin(board, cIdx)) {
+                quiet.push_back(cIdx);
+            }
+        }
+        const std::vector<int> &pool = quiet.empty() ? candidates : quiet;
+        if (pool.empty()) {
+            break;
+        }
+        int move = pool[rng() % pool.size()];
+        moves.push_back(move);
+        board = board.forMove(move);
+    }
+    return moves;
+}
+
+static Board mirrored(const Board &board) {
+    std::array<uint64_t, 2> pieces{0, 0};
+    for (uint32_t player = 0; player < 2; player++) {
+        for (uint32_t cIdx = 0; cIdx < 7; cIdx++) {
+            pieces[player] |= ((board.pieces[player] >> (cIdx * 6)) & 0x3Fu) << ((6 - cIdx) * 6);
+        }
+    }
+    return Board(pieces);
+}
+
+static bool matches(const Evaluation &optimized, const EvaluationPart &reference) {
+    return optimized.score == reference.score && optimized.winIn == reference.winIn;
+}
+
+// Returns the name of the first engine that disagrees with the reference, or
+// nullptr when they all agree.
+static const char* findMismatch(const Board &board, uint32_t depth, SearchCache &cache, const std::string &snapshotPath,
+                               Evaluation &optimized, EvaluationPart &reference) {
+    reference = evaluateReference(board, depth);
+
+    optimized = board.evaluate(depth);
+    if (!matches(optimized, reference)) {
+        return "evaluate";
+    }
+    optimized = board.evaluate(depth, &cache);
+    if (!matches(optimized, reference)) {
+        return "evaluate+cache";
+    }
+    // Keep every entry, so the loaded snapshot answers most of the search.
+    SearchCache saved(DIFF_SNAPSHOT_CAPACITY, SnapshotPolicy{0, true});
+    board.evaluate(depth, &saved);
+    SearchCache loaded(DIFF_SNAPSHOT_CAPACITY, SnapshotPolicy{0, true});
+    if (!saved.save(snapshotPath) || !loaded.load(snapshotPath)) {
+        optimized = Evaluation(0, -1, 0, depth);
+        return "snapshot save/load";
+    }
+    optimized = board.evaluate(depth, &loaded);
+    if (!matches(optimized, reference)) {
+        return "evaluate+loaded snapshot";
+    }
+    // Solved from two plies down, so the search crosses into the tablebase.
+    uint32_t empty = 42 - board.turnCount();
+    if (empty <= DIFF_TABLEBASE_MAX_EMPTY) {
+        Tablebase tablebase;
+        tablebase.generate({board}, empty - 2, 1);
+        SearchCache withTablebase(DIFF_SNAPSHOT_CAPACITY);
+        withTablebase.attachTablebase(&tablebase);
+        optimized = board.evaluate(depth, &withTablebase);
+        if (!matches(optimized, reference)) {
+            return "evaluate+tablebase";
+        }
+    }
+    optimized = mirrored(board).evaluate(depth);
+    if (!matches(optimized, reference)) {
+        return "evaluate(mirrored)";
+    }
+    // Threat-space wins need not be the fastest, only real.
+    ThreatSpaceResult threats = threatSpaceSearch(board, depth, THREAT_SPACE_NODE_BUDGET);
+    if (threats.proven && (reference.score != 1 || reference.winIn > threats.winIn)) {
+        optimized = Evaluation(1, threats.line.front(), threats.winIn, depth);
+        return "threatSpaceSearch";
+    }
+    return nullptr;
+}
+
+static bool stillMismatches(const std::vector<int> &moves, uint32_t depth, const std::string &snapshotPath) {
+    Board board({0, 0});
+    if (depth == 0 || !replay(moves, board) || board.turnCount() + depth > 42) {
+        return false;
+    }
+    SearchCache cache(DIFF_CACHE_CAPACITY, SnapshotPolicy{0, true});
+    Evaluation optimized;
+    EvaluationPart reference;
+    return findMismatch(board, depth, cache, snapshotPath, optimized, reference) != nullptr;
+}
+
+// Greedily drops moves and search depth while the mismatch persists. Cached
+// mismatches may depend on what the worker searched earlier and not shrink.
+static void shrink(std::vector<int> &moves, uint32_t &depth, const std::string &snapshotPath) {
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        while (stillMismatches(moves, depth - 1, snapshotPath)) {
+            depth--;
+            progress = true;
+        }
+        for (size_t i = moves.size(); i > 0; i--) {
+            std::vector<int> candidate(moves.begin(), moves.begin() + (i - 1));
+            candidate.insert(candidate.end(), moves.begin() + i, moves.end());
+            if (stillMismatches(candidate, depth, snapshotPath)) {
+                moves.swap(candidate);
+                progress = true;
+            }
+        }
+        // Dropping one move of each side keeps the side to move, which single
+        // deletions rarely do without losing the mismatch.
+        for (size_t i = 0; i < moves.size() && !progress; i++) {
+            for (size_t j = i + 1; j < moves.size() && !progress; j += 2) {
+                std::vector<int> candidate = moves;
+                candidate.erase(candidate.begin() + j);
+                candidate.erase(candidate.begin() + i);
+                if (stillMismatches(candidate, depth, snapshotPath)) {
+                    moves.swap(candidate);
+                    progress = true;
+                }
+            }
+        }
+    }
+}
+
+// Finishes the generated game with the last column that wins on the spot, if
+// there is one, so a win with a second winning column is covered too. Then
+// checks every analyzed ply's best and played values against the reference.
+// Returns the name of the first value that disagrees, or nullptr.
+static const char* findAnalysisMismatch(std::vector<int> moves, uint32_t maxDepth, DiffMismatch &mismatch) {
+    Board last({0, 0});
+    replay(moves, last);
+    for (int cIdx = 6; cIdx >= 0; cIdx--) {
+        if (last.canPlay(cIdx) && last.doesMoveWin(cIdx)) {
+            moves.push_back(cIdx);
+            break;
+        }
+    }
+
+    SearchCache cache(DIFF_SNAPSHOT_CAPACITY, SnapshotPolicy{0, true});
+    GameAnalysis analysis = analyzeGame(Board({0, 0}), moves, maxDepth, cache);
+    if (analysis.plies.size() != moves.size()) {
+        mismatch = {last.toCfef(), maxDepth, "", Evaluation(0, -1, analysis.plies.size(), maxDepth), EvaluationPart(0, moves.size())};
+        return "analyzeGame(ply count)";
+    }
+
+    for (const PlyAnalysis &ply : analysis.plies) {
+        Board board = Board::fromCfef(ply.cfef);
+        EvaluationPart reference = evaluateReference(board, ply.depth);
+        if (!matches(ply.best, reference)) {
+            mismatch = {ply.cfef, ply.depth, "", ply.best, reference};
+            return "analyzeGame(best)";
+        }
+
+        EvaluationPart playedReference(0, 1);
+        if (board.doesMoveWin(ply.played)) {
+            playedReference = EvaluationPart(1, 1);
+        } else if (ply.depth > 1) {
+            EvaluationPart reply = evaluateReference(board.forMove(ply.played), ply.depth - 1);
+            playedReference = EvaluationPart(-reply.score, reply.winIn + 1);
+        }
+        if (ply.playedValue.score != playedReference.score || ply.playedValue.winIn != playedReference.winIn) {
+            mismatch = {ply.cfef, ply.depth, "", Evaluation(ply.playedValue.score, ply.played, ply.playedValue.winIn, ply.depth), playedReference};
+            return "analyzeGame(played)";
+        }
+    }
+    return nullptr;
+}
+
+DiffReport runDifferential(const DiffConfig &config) {
+    DiffReport report;
+    // There is nothing to search at depth 0.
+    if (config.maxDepth == 0) {
+        return report;
+    }
+    std::atomic<uint64_t> next(0);
+    std::atomic<uint64_t> checked(0);
+    std::atomic<uint64_t> mismatchCount(0);
+    std::mutex reportMutex;
+
+    auto worker = [&](const std::string &snapshotPath) {
+        SearchCache cache(DIFF_CACHE_CAPACITY, SnapshotPolicy{0, true});
+        while (true) {
+            uint64_t idx = next++;
+            if (idx >= config.positions) {
+                return;
+            }
+            std::mt19937_64 rng(splitMix(config.seed ^ splitMix(idx)));
+            std::vector<int> moves = generateMoves(rng);
+            Board board({0, 0});
+            replay(moves, board);
+
+            if (idx % DIFF_ANALYSIS_INTERVAL == 0) {
+                DiffMismatch mismatch;
+                const char* engine = findAnalysisMismatch(moves, config.maxDepth, mismatch);
+                checked++;
+                if (engine != nullptr) {
+                    mismatchCount++;
+                    mismatch.engine = engine;
+                    std::lock_guard<std::mutex> lock(reportMutex);
+                    if (report.mismatches.size() < config.maxReported) {
+                        report.mismatches.push_back(mismatch);
+                    }
+                }
+            }
+
+            uint32_t depthCap = std::min<uint32_t>(config.maxDepth, 42 - board.turnCount());
+            std::vector<uint32_t> depths = {1 + (uint32_t)(rng() % depthCap)};
+
+            // Probe either side of the horizon of any forced result.
+            EvaluationPart deep = evaluateReference(board, depthCap);
+            if (deep.score != 0 && deep.winIn > 1) {
+                depths.push_back(deep.winIn);
+                depths.push_back(deep.winIn - 1);
+            }
+
+            for (uint32_t depth : depths) {
+                Evaluation optimized;
+                EvaluationPart reference;
+                const char* engine = findMismatch(board, depth, cache, snapshotPath, optimized, reference);
+                checked++;
+                if (engine == nullptr) {
+                    continue;
+                }
+                mismatchCount++;
+
+                std::lock_guard<std::mutex> lock(reportMutex);
+                if (report.mismatches.size() >= config.maxReported) {
+                    continue;
+                }
+                std::vector<int> shrunk = moves;
+                uint32_t shrunkDepth = depth;
+                Board reproducer = board;
+                if (stillMismatches(shrunk, shrunkDepth, snapshotPath)) {
+                    shrink(shrunk, shrunkDepth, snapshotPath);
+                    replay(shrunk, reproducer);
+                    SearchCache fresh(DIFF_CACHE_CAPACITY, SnapshotPolicy{0, true});
+                    engine = findMismatch(reproducer, shrunkDepth, fresh, snapshotPath, optimized, reference);
+                }
+                report.mismatches.push_back({reproducer.toCfef(), shrunkDepth, engine, optimized, reference});
+            }
+        }
+    };
+
+    std::vector<std::string> snapshotPaths;
+    for (uint32_t i = 0; i < std::max<uint32_t>(config.threads, 1); i++) {
+        snapshotPaths.push_back(config.scratchPath + "." + std::to_string(getpid()) + "." + std::to_string(i));
+    }
+    std::vector<std::thread> threads;
+    for (const std::string &snapshotPath : snapshotPaths) {
+        threads.emplace_back(worker, snapshotPath);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const std::string &snapshotPath : snapshotPaths) {
+        std::remove(snapshotPath.c_str());
+    }
+
+    report.checked = checked;
+    report.mismatchCount = mismatchCount;
+    return report;
+}
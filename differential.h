@@ -0,0 +1,40 @@
+#ifndef CONNECT_FOUR_DIFFERENTIAL_H
+#define CONNECT_FOUR_DIFFERENTIAL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "connect-four.h"
+
+// Differential check of Board::evaluate against evaluateReference. Positions
+// are generated from a seed and an index, so any reported mismatch can be
+// regenerated on its own.
+
+struct DiffConfig {
+    uint64_t positions = 100000;
+    uint32_t maxDepth = 6;
+    uint32_t threads = 1;
+    uint64_t seed = 1;
+    uint32_t maxReported = 10;
+    // Each worker saves and maps back snapshots at this path plus a suffix.
+    std::string scratchPath = "/tmp/connect-four-diff";
+};
+
+struct DiffMismatch {
+    std::string cfef;
+    uint32_t depth;
+    std::string engine;
+    Evaluation optimized;
+    EvaluationPart reference;
+};
+
+struct DiffReport {
+    uint64_t checked = 0;
+    uint64_t mismatchCount = 0;
+    std::vector<DiffMismatch> mismatches;
+};
+
+DiffReport runDifferential(const DiffConfig &config);
+
+#endif //CONNECT_FOUR_DIFFERENTIAL_H
@@ -8,8 +8,8 @@
 #include <cstdint>
 #include <iostream>
 
-static uint64_t tooManySubmaps = 0;
-static uint64_t tooManyEntries = 0;
+static thread_local uint64_t tooManySubmaps = 0;
+static thread_local uint64_t tooManyEntries = 0;
 
 static constexpr uint64_t SUBMAP_CAPACITY[] = {1,8,48,64,128,128,384,512,1024,1024,1024,1024,1024};
 
@@ -1,6 +1,15 @@
 #include <iostream>
 #include <chrono>
 #include "connect-four.h"
+#include "search-cache.h"
+#include "differential.h"
+#include "analysis.h"
+#include "threat-space.h"
+#include "mcts.h"
+#include "tablebase.h"
+#include <memory>
+#include <random>
+#include <thread>
 
 
 void playFixedDepth(std::string cfef, bool playerIsP1, int depth) {
@@ -42,7 +51,16 @@ void playFixedDepth(std::string cfef, bool playerIsP1, int depth) {
     }
 }
 
-void play(std::string cfef, bool playerIsP1, uint64_t msAllowed) {
+enum class SearchEngine { AlphaBeta, Mcts };
+
+Evaluation chooseMove(const Board &board, uint64_t msAllowed, SearchEngine engine, SearchCache *cache, MctsEngine *mcts) {
+    if (engine == SearchEngine::Mcts) {
+        return mcts->search(board, msAllowed);
+    }
+    return evaluateDynamicDepth(board, msAllowed, cache);
+}
+
+void play(std::string cfef, bool playerIsP1, uint64_t msAllowed, SearchEngine engine, SearchCache *cache, MctsEngine *mcts) {
     Board board = Board::fromCfef(cfef);
     std::cout << board.visualRep();
     while (true) {
@@ -63,11 +81,15 @@ void play(std::string cfef, bool playerIsP1, uint64_t msAllowed) {
 
         } else {
             auto start = std::chrono::high_resolution_clock::now();
-            auto eval = evaluateDynamicDepth(board, msAllowed);
+            auto eval = chooseMove(board, msAllowed, engine, cache, mcts);
             auto end = std::chrono::high_resolution_clock::now();
             auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count();
 
-            std::cout << eval.move << " value: " << eval.score << " depth: " << eval.depth << " millis: " << millis << '\n';
+            std::cout << eval.move << " value: " << eval.score << " depth: " << eval.depth << " millis: " << millis;
+            if (engine == SearchEngine::Mcts) {
+                std::cout << " playouts: " << mcts->lastPlayouts << " reusedVisits: " << mcts->lastReusedVisits;
+            }
+            std::cout << '\n';
 
             if (board.doesMoveWin(eval.move)) {
                 std::cout << "CPU WINS\n";
@@ -81,14 +103,295 @@ void play(std::string cfef, bool playerIsP1, uint64_t msAllowed) {
     }
 }
 
+// Plays the two engines against each other at the same average time per
+// move, each side playing first in half the games after two random opening
+// moves. Alpha-beta searches cannot be cut short, so it banks the time its
+// last depth left unused, or owes what it overran, for its next move.
+int match(int argc, const char* argv[]) {
+    uint64_t msAllowed = argc >= 3 ? std::stoull(argv[2]) : 50;
+    int games = argc >= 4 ? std::stoi(argv[3]) : 10;
+
+    SearchCache cache(SEARCH_CACHE_CAPACITY);
+    std::mt19937 rng(std::random_device{}());
+    int mctsWins = 0, alphaBetaWins = 0, draws = 0;
+    uint64_t millis[2] = {0, 0};
+    uint64_t moves[2] = {0, 0};
+    // Alpha-beta stops once it proves a result, so its moves after that are
+    // quick and pull its average under the limit.
+    uint64_t undecidedMillis = 0;
+    uint64_t undecidedMoves = 0;
+    uint64_t playouts = 0;
+    uint64_t reusedVisits = 0;
+
+    for (int game = 0; game < games; game++) {
+        MctsEngine mcts(std::thread::hardware_concurrency());
+        bool mctsIsP1 = game % 2 == 0;
+        int64_t alphaBetaBankMs = 0;
+        Board board = Board::fromCfef("//////");
+        for (int i = 0; i < 2; i++) {
+            board = board.forMove(rng() % 7);
+        }
+
+        while (true) {
+            if (board.turnCount() > 41) {
+                draws++;
+                break;
+            }
+            bool mctsTurn = board.isP1Turn() == mctsIsP1;
+            auto start = std::chrono::high_resolution_clock::now();
+            uint64_t alphaBetaMs = std::max<int64_t>((int64_t)msAllowed + alphaBetaBankMs, 0);
+            auto eval = mctsTurn ? mcts.search(board, msAllowed) : evaluateForTime(board, alphaBetaMs, &cache);
+            auto end = std::chrono::high_resolution_clock::now();
+            int64_t moveMillis = std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count();
+            millis[mctsTurn] += moveMillis;
+            if (mctsTurn) {
+                playouts += mcts.lastPlayouts;
+                reusedVisits += mcts.lastReusedVisits;
+            } else {
+                alphaBetaBankMs += (int64_t)msAllowed - moveMillis;
+                if (eval.score == 0) {
+                    undecidedMillis += moveMillis;
+                    undecidedMoves++;
+                }
+            }
+            moves[mctsTurn]++;
+
+            if (board.doesMoveWin(eval.move)) {
+                (mctsTurn ? mctsWins : alphaBetaWins)++;
+                break;
+            }
+            board = board.forMove(eval.move);
+        }
+    }
+
+    std::cout << "mcts: " << mctsWins << " alphaBeta: " << alphaBetaWins << " draws: " << draws
+              << " mctsMillisPerMove: " << millis[1] / std::max<uint64_t>(moves[1], 1)
+              << " mctsPlayoutsPerMove: " << playouts / std::max<uint64_t>(moves[1], 1)
+              << " mctsReusedVisitsPerMove: " << reusedVisits / std::max<uint64_t>(moves[1], 1)
+              << " alphaBetaMillisPerMove: " << millis[0] / std::max<uint64_t>(moves[0], 1)
+              << " (undecided: " << undecidedMillis / std::max<uint64_t>(undecidedMoves, 1) << ")" << std::endl;
+    return 0;
+}
+
+// Checks a sample of entries against the reference minimax searched to the
+// end of the game.
+int verifyTablebase(const Tablebase &tablebase, uint64_t samples) {
+    std::mt19937_64 rng(1);
+    uint64_t mismatches = 0;
+    for (uint64_t i = 0; i < samples && tablebase.size() > 0; i++) {
+        Board board = Tablebase::boardForKey(tablebase.keyAt(rng() % tablebase.size()));
+        uint64_t piecesTurn = board.isP1Turn() ? board.pieces[0] : board.pieces[1];
+        uint64_t piecesOther = board.isP1Turn() ? board.pieces[1] : board.pieces[0];
+        EvaluationPart stored;
+        tablebase.probe(piecesTurn, piecesOther, stored);
+        EvaluationPart reference = evaluateReference(board, 42 - board.turnCount());
+        if (stored.score != reference.score || (stored.score != 0 && stored.winIn != reference.winIn)) {
+            mismatches++;
+            std::cout << "MISMATCH cfef: " << board.toCfef() << " stored: " << (int)stored.score << "/" << (int)stored.winIn
+                      << " reference: " << (int)reference.score << "/" << (int)reference.winIn << '\n';
+        }
+    }
+    std::cout << "verified: " << samples << " mismatches: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+int tablebase(int argc, const char* argv[]) {
+    std::string mode = argc >= 3 ? argv[2] : "";
+    Tablebase tablebase;
+
+    if (mode == "build" && argc >= 6) {
+        uint32_t maxEmpty = std::stoul(argv[3]);
+        std::vector<Board> seeds;
+        for (int i = 5; i < argc; i++) {
+            seeds.push_back(Board::fromCfef(argv[i]));
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        tablebase.generate(seeds, maxEmpty, std::thread::hardware_concurrency());
+        auto end = std::chrono::high_resolution_clock::now();
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count();
+
+        std::cout << "positions: " << tablebase.size() << " millis: " << millis << std::endl;
+        if (!tablebase.save(argv[4])) {
+            std::cout << "failed to save tablebase to " << argv[4] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (mode == "verify" && argc >= 4) {
+        if (!tablebase.load(argv[3])) {
+            std::cout << "no usable tablebase at " << argv[3] << std::endl;
+            return 1;
+        }
+        return verifyTablebase(tablebase, argc >= 5 ? std::stoull(argv[4]) : 1000);
+    }
+    std::cout << "tablebase build maxEmpty file seedCfef1 seedCfef2 ...\n"
+              << "tablebase verify file samples-optional" << std::endl;
+    return 1;
+}
+
+int diff(int argc, const char* argv[]) {
+    DiffConfig config;
+    if (argc >= 3) config.positions = std::stoull(argv[2]);
+    if (argc >= 4) config.maxDepth = std::stoul(argv[3]);
+    if (argc >= 5) config.threads = std::stoul(argv[4]);
+    if (argc >= 6) config.seed = std::stoull(argv[5]);
+    if (config.maxDepth == 0) {
+        std::cout << "maxDepth must be at least 1" << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    DiffReport report = runDifferential(config);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count();
+
+    for (const auto &mismatch : report.mismatches) {
+        std::cout << "MISMATCH " << mismatch.engine << " cfef: " << mismatch.cfef << " depth: " << mismatch.depth
+                  << " optimized: " << mismatch.optimized.score << "/" << mismatch.optimized.winIn
+                  << " reference: " << (int)mismatch.reference.score << "/" << (int)mismatch.reference.winIn << '\n';
+    }
+    std::cout << "checked: " << report.checked << " mismatches: " << report.mismatchCount << " millis: " << millis << std::endl;
+    return report.mismatchCount == 0 ? 0 : 1;
+}
+
+void printAnalysis(const GameAnalysis &analysis, const std::vector<int> &moves) {
+    const std::vector<PlyAnalysis> &plies = analysis.plies;
+    uint64_t totalMicros = 0;
+    for (const auto &ply : plies) {
+        std::cout << "ply: " << ply.ply << " cfef: " << ply.cfef << " played: " << ply.played
+                  << " best: " << ply.best.move << " value: " << ply.best.score << "/" << ply.best.winIn
+                  << " playedValue: " << (int)ply.playedValue.score << "/" << (int)ply.playedValue.winIn
+                  << " depth: " << ply.depth << " micros: " << ply.micros;
+        if (ply.swing > 0) {
+            std::cout << " BLUNDER(" << ply.swing << ")";
+        }
+        std::cout << '\n';
+        totalMicros += ply.micros;
+    }
+    std::cout << "plies: " << plies.size() << " millis: " << totalMicros / 1000 << std::endl;
+    if (analysis.illegalMove >= 0) {
+        std::cout << "move " << analysis.illegalMove << " (column " << moves[analysis.illegalMove]
+                  << ") cannot be played; analyzed the " << plies.size() << " moves before it" << std::endl;
+    }
+}
+
+int analyze(int argc, const char* argv[]) {
+    std::vector<int> moves;
+    Board start = Board::fromCfef("//////");
+    uint32_t maxDepth = 10;
+
+    if (std::string(argv[1]) == "analyze") {
+        if (argc < 3 || !movesFromString(argv[2], moves)) {
+            std::cout << "moves must be a string of columns 0-6" << std::endl;
+            return 1;
+        }
+        if (argc >= 4) maxDepth = std::stoul(argv[3]);
+    } else {
+        if (argc < 4) {
+            std::cout << "need a depth and at least two CFEFs" << std::endl;
+            return 1;
+        }
+        maxDepth = std::stoul(argv[2]);
+        std::vector<std::string> cfefs(argv + 3, argv + argc);
+        if (!movesFromCfefs(cfefs, moves)) {
+            std::cout << "each CFEF must follow from the previous one by a single move" << std::endl;
+            return 1;
+        }
+        start = Board::fromCfef(cfefs.front());
+    }
+
+    if (maxDepth == 0) {
+        std::cout << "maxDepth must be at least 1" << std::endl;
+        return 1;
+    }
+
+    SearchCache cache(ANALYSIS_CACHE_CAPACITY, SnapshotPolicy{ANALYSIS_CACHE_MIN_DEPTH, true});
+    printAnalysis(analyzeGame(start, moves, maxDepth, cache), moves);
+    return 0;
+}
+
+int threats(int argc, const char* argv[]) {
+    Board board = Board::fromCfef(argc >= 3 ? argv[2] : "//////");
+    auto start = std::chrono::high_resolution_clock::now();
+    ThreatSpaceResult result = threatSpaceSearch(board, 42 - board.turnCount(), THREAT_SPACE_NODE_BUDGET);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(end-start).count();
+
+    if (result.proven) {
+        std::cout << "win in: " << result.winIn << " line:";
+        for (int move : result.line) {
+            std::cout << ' ' << move;
+        }
+        std::cout << '\n';
+    } else {
+        std::cout << "no threat-space win\n";
+    }
+    std::cout << "nodes: " << result.nodes << " micros: " << micros << std::endl;
+    return 0;
+}
+
 int main(int argc, const char* argv[]) {
     if (argc < 2) {
-        std::cout << "Usage: playerGoesFirst(y/n) startingCfef-optional" << std::endl;
+        std::cout << "Usage: playerGoesFirst(y/n) startingCfef-optional cacheFile-optional engine(ab/mcts)-optional tablebaseFile-optional" << std::endl;
+        std::cout << "       diff positions-optional maxDepth-optional threads-optional seed-optional" << std::endl;
+        std::cout << "       analyze moves maxDepth-optional" << std::endl;
+        std::cout << "       analyze-cfef maxDepth cfef1 cfef2 ..." << std::endl;
+        std::cout << "       threats cfef" << std::endl;
+        std::cout << "       match msPerMove-optional games-optional" << std::endl;
+        std::cout << "       tablebase build maxEmpty file seedCfef1 seedCfef2 ..." << std::endl;
+        std::cout << "       tablebase verify file samples-optional" << std::endl;
+        return 1;
+    }
+    if (std::string(argv[1]) == "diff") {
+        return diff(argc, argv);
+    }
+    if (std::string(argv[1]) == "analyze" || std::string(argv[1]) == "analyze-cfef") {
+        return analyze(argc, argv);
+    }
+    if (std::string(argv[1]) == "threats") {
+        return threats(argc, argv);
+    }
+    if (std::string(argv[1]) == "match") {
+        return match(argc, argv);
+    }
+    if (std::string(argv[1]) == "tablebase") {
+        return tablebase(argc, argv);
     }
     bool playerIsFirst = std::string(argv[1]) == "y";
-    std::string cfef = argc == 3 ? argv[1] : "//////";
+    std::string cfef = argc >= 3 ? argv[2] : "//////";
+
+    SearchCache cache(SEARCH_CACHE_CAPACITY);
+    std::string cachePath = argc >= 4 ? argv[3] : "";
+    if (!cachePath.empty()) {
+        if (cache.load(cachePath)) {
+            std::cout << "loaded " << cache.size() << " cached positions from " << cachePath << std::endl;
+        } else {
+            std::cout << "no usable cache at " << cachePath << ", starting cold" << std::endl;
+        }
+    }
+
+    Tablebase tablebase;
+    if (argc >= 6) {
+        if (tablebase.load(argv[5])) {
+            cache.attachTablebase(&tablebase);
+            std::cout << "loaded " << tablebase.size() << " tablebase positions from " << argv[5] << std::endl;
+        } else {
+            std::cout << "no usable tablebase at " << argv[5] << std::endl;
+        }
+    }
+
+    SearchEngine engine = argc >= 5 && std::string(argv[4]) == "mcts" ? SearchEngine::Mcts : SearchEngine::AlphaBeta;
+    // The node pool is large, so only build it when it will be used.
+    std::unique_ptr<MctsEngine> mcts;
+    if (engine == SearchEngine::Mcts) {
+        mcts.reset(new MctsEngine(std::thread::hardware_concurrency()));
+    }
 
-    play(cfef, playerIsFirst, 3000);
+    play(cfef, playerIsFirst, 3000, engine, &cache, mcts.get());
+
+    if (!cachePath.empty() && !cache.save(cachePath)) {
+        std::cout << "failed to save cache to " << cachePath << std::endl;
+    }
 //    test();
     return 0;
 }
@@ -0,0 +1,73 @@
+#include "mapped-file.h"
+
+#include <cstdio>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t checksumBytes(uint64_t hash, const void* data, size_t length) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3llu;
+    }
+    return hash;
+}
+
+bool writeFileAtomically(const std::string &path, const std::vector<std::pair<const void*, size_t>> &parts) {
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        for (const auto &part : parts) {
+            file.write(static_cast<const char*>(part.first), part.second);
+        }
+        if (!file) {
+            return false;
+        }
+    }
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+MappedFile::~MappedFile() {
+    unmap();
+}
+
+bool MappedFile::map(const std::string &path) {
+    unmap();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    base = mapped;
+    length = st.st_size;
+    return true;
+}
+
+void MappedFile::unmap() {
+    if (base != nullptr) {
+        munmap(base, length);
+    }
+    base = nullptr;
+    length = 0;
+}
+
+const char* MappedFile::data() const {
+    return static_cast<const char*>(base);
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
@@ -0,0 +1,42 @@
+#ifndef CONNECT_FOUR_MAPPED_FILE_H
+#define CONNECT_FOUR_MAPPED_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// What the files that are mapped in place (SearchCache snapshots and
+// tablebases) have in common: the checksum over their contents, the read-only
+// mapping, and a write that a reader never sees half done.
+
+const uint64_t CHECKSUM_SEED = 0xCBF29CE484222325llu;
+
+// FNV-1a, continued from hash so several ranges can be checked as one.
+uint64_t checksumBytes(uint64_t hash, const void* data, size_t length);
+
+// Writes the parts in order next to path and renames the result over it.
+bool writeFileAtomically(const std::string &path, const std::vector<std::pair<const void*, size_t>> &parts);
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &rhs) = delete;
+    MappedFile& operator=(const MappedFile &rhs) = delete;
+
+    // Maps the whole file read-only; fails on a missing or empty file.
+    bool map(const std::string &path);
+    void unmap();
+
+    const char* data() const;
+    size_t size() const;
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+};
+
+#endif //CONNECT_FOUR_MAPPED_FILE_H
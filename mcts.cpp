@@ -0,0 +1,305 @@
+#include "mcts.h"
+
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+static const int COLUMN_ORDER[] = {3, 2, 4, 1, 5, 0, 6};
+
+// Terminal states of a node, as seen by the side that played into it.
+static const int8_t NOT_TERMINAL = 0;
+static const int8_t TERMINAL_WIN = 1;
+static const int8_t TERMINAL_DRAW = 2;
+
+// Expansion states.
+static const uint8_t UNEXPANDED = 0;
+static const uint8_t EXPANDING = 1;
+static const uint8_t EXPANDED = 2;
+
+static uint64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t xorShift(uint64_t &state) {
+    state ^= state << 13u;
+    state ^= state >> 7u;
+    state ^= state << 17u;
+    return state;
+}
+
+static uint64_t colMask(uint32_t cIdx) {
+    return (uint64_t)0x3Fu << (cIdx * 6);
+}
+
+static uint64_t randomBit(uint64_t bits, uint64_t &rng) {
+    int skip = xorShift(rng) % __builtin_popcountll(bits);
+    while (skip-- > 0) {
+        bits &= bits - 1;
+    }
+    return bits & -bits;
+}
+
+// Light playout: take a win when there is one, block the opponent's when
+// there is one, otherwise play a random column. Returns +1 if the side to
+// move at the start wins, -1 if it loses and 0 for a draw.
+static int playout(uint64_t piecesTurn, uint64_t piecesOther, uint64_t &rng) {
+    int sign = 1;
+    while (true) {
+        uint64_t combinedPieces = piecesTurn | piecesOther;
+        uint64_t playable = playableMask(combinedPieces);
+        if (playable == 0) {
+            return 0;
+        }
+        if (threatMask(piecesTurn, combinedPieces) & playable) {
+            return sign;
+        }
+        uint64_t blocks = threatMask(piecesOther, combinedPieces) & playable;
+        uint64_t move = blocks != 0 ? blocks & -blocks : randomBit(playable, rng);
+
+        uint64_t piecesTurnAfter = piecesTurn | move;
+        piecesTurn = piecesOther;
+        piecesOther = piecesTurnAfter;
+        sign = -sign;
+    }
+}
+
+MctsEngine::MctsEngine(uint32_t threads, uint32_t poolCapacity)
+    : threads(threads), poolCapacity(poolCapacity), pool(new MctsNode[poolCapacity]),
+      poolSize(0), poolFull(false), maxDepth(0), rootBoard({0, 0}) {}
+
+MctsEngine::MctsEngine(uint32_t threads) : MctsEngine(threads, MCTS_POOL_CAPACITY) {}
+
+// Index 0 always holds a root, so it doubles as the out-of-pool result.
+// Once it fails, poolFull keeps later callers from pushing poolSize on
+// towards wrapping around.
+uint32_t MctsEngine::allocNodes(uint32_t count) {
+    if (poolFull.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    uint32_t first = poolSize.fetch_add(count);
+    if (first + count > poolCapacity) {
+        poolFull.store(true, std::memory_order_relaxed);
+        return 0;
+    }
+    for (uint32_t i = first; i < first + count; i++) {
+        MctsNode &node = pool[i];
+        node.visits.store(0, std::memory_order_relaxed);
+        node.reward.store(0, std::memory_order_relaxed);
+        node.state.store(UNEXPANDED, std::memory_order_relaxed);
+        node.move = 0;
+        node.childCount = 0;
+        node.terminal = NOT_TERMINAL;
+        node.firstChild = 0;
+    }
+    return first;
+}
+
+void MctsEngine::resetTree(const Board &board) {
+    poolSize = 0;
+    poolFull = false;
+    root = allocNodes(1);
+    rootBoard = board;
+    hasTree = true;
+}
+
+// Moves the root down to the node for board if it is the root or one of the
+// two plies below it, and there is enough of the pool left to keep growing.
+bool MctsEngine::reuseTree(const Board &board) {
+    if (!hasTree || poolSize.load() > poolCapacity / 4 * 3) {
+        return false;
+    }
+    if (rootBoard == board) {
+        return true;
+    }
+    const MctsNode &rootNode = pool[root];
+    if (rootNode.state.load(std::memory_order_acquire) != EXPANDED) {
+        return false;
+    }
+    for (uint32_t i = 0; i < rootNode.childCount; i++) {
+        uint32_t childIdx = rootNode.firstChild + i;
+        const MctsNode &child = pool[childIdx];
+        Board afterChild = rootBoard.forMove(child.move);
+        if (afterChild == board) {
+            root = childIdx;
+            rootBoard = board;
+            return true;
+        }
+        if (child.state.load(std::memory_order_acquire) != EXPANDED) {
+            continue;
+        }
+        for (uint32_t j = 0; j < child.childCount; j++) {
+            uint32_t grandchildIdx = child.firstChild + j;
+            if (afterChild.forMove(pool[grandchildIdx].move) == board) {
+                root = grandchildIdx;
+                rootBoard = board;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool MctsEngine::expand(MctsNode &node, uint64_t piecesTurn, uint64_t piecesOther) {
+    uint64_t combinedPieces = piecesTurn | piecesOther;
+    uint64_t playable = playableMask(combinedPieces);
+    uint64_t wins = threatMask(piecesTurn, combinedPieces) & playable;
+
+    uint32_t first = allocNodes(__builtin_popcountll(playable));
+    if (first == 0) {
+        return false;
+    }
+    uint32_t count = 0;
+    for (int cIdx : COLUMN_ORDER) {
+        uint64_t move = playable & colMask(cIdx);
+        if (move == 0) {
+            continue;
+        }
+        MctsNode &child = pool[first + count++];
+        child.move = cIdx;
+        if (wins & move) {
+            child.terminal = TERMINAL_WIN;
+        } else if (__builtin_popcountll(combinedPieces) == 41) {
+            child.terminal = TERMINAL_DRAW;
+        }
+    }
+    node.firstChild = first;
+    node.childCount = count;
+    node.state.store(EXPANDED, std::memory_order_release);
+    return true;
+}
+
+uint32_t MctsEngine::select(const MctsNode &node) const {
+    double logVisits = std::log((double)std::max(node.visits.load(std::memory_order_relaxed), 1));
+    uint32_t best = node.firstChild;
+    double bestScore = -1;
+    for (uint32_t i = node.firstChild; i < node.firstChild + node.childCount; i++) {
+        const MctsNode &child = pool[i];
+        if (child.terminal == TERMINAL_WIN) {
+            return i;
+        }
+        int32_t visits = child.visits.load(std::memory_order_relaxed);
+        if (visits <= 0) {
+            return i;
+        }
+        double q = child.reward.load(std::memory_order_relaxed) / (2.0 * visits);
+        double score = q + MCTS_EXPLORATION * std::sqrt(logVisits / visits);
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+uint64_t MctsEngine::runPlayouts(uint64_t deadlineNanos, uint64_t seed) {
+    uint64_t rng = seed | 1u;
+    uint64_t playouts = 0;
+    std::vector<uint32_t> path;
+    uint64_t rootTurn = rootBoard.isP1Turn() ? rootBoard.pieces[0] : rootBoard.pieces[1];
+    uint64_t rootOther = rootBoard.isP1Turn() ? rootBoard.pieces[1] : rootBoard.pieces[0];
+
+    while (nowNanos() < deadlineNanos) {
+        path.clear();
+        uint64_t piecesTurn = rootTurn;
+        uint64_t piecesOther = rootOther;
+        uint32_t nodeIdx = root;
+        path.push_back(nodeIdx);
+        pool[nodeIdx].visits.fetch_add(MCTS_VIRTUAL_LOSS, std::memory_order_relaxed);
+
+        // Result for the side to move at the end of the path.
+        int result;
+        while (true) {
+            MctsNode &node = pool[nodeIdx];
+            if (node.terminal == TERMINAL_WIN) {
+                result = -1;
+                break;
+            }
+            if (node.terminal == TERMINAL_DRAW) {
+                result = 0;
+                break;
+            }
+            uint8_t state = node.state.load(std::memory_order_acquire);
+            if (state == UNEXPANDED && node.visits.load(std::memory_order_relaxed) > MCTS_VIRTUAL_LOSS &&
+                !poolFull.load(std::memory_order_relaxed)) {
+                uint8_t expected = UNEXPANDED;
+                if (node.state.compare_exchange_strong(expected, EXPANDING) && expand(node, piecesTurn, piecesOther)) {
+                    state = EXPANDED;
+                }
+            }
+            if (state != EXPANDED) {
+                result = playout(piecesTurn, piecesOther, rng);
+                break;
+            }
+
+            nodeIdx = select(node);
+            uint64_t move = playableMask(piecesTurn | piecesOther) & colMask(pool[nodeIdx].move);
+            uint64_t piecesTurnAfter = piecesTurn | move;
+            piecesTurn = piecesOther;
+            piecesOther = piecesTurnAfter;
+            path.push_back(nodeIdx);
+            pool[nodeIdx].visits.fetch_add(MCTS_VIRTUAL_LOSS, std::memory_order_relaxed);
+        }
+
+        for (size_t i = path.size(); i-- > 0;) {
+            MctsNode &node = pool[path[i]];
+            node.reward.fetch_add(1 - result, std::memory_order_relaxed);
+            node.visits.fetch_add(1 - MCTS_VIRTUAL_LOSS, std::memory_order_relaxed);
+            result = -result;
+        }
+
+        uint32_t depth = path.size() - 1;
+        uint32_t seen = maxDepth.load(std::memory_order_relaxed);
+        while (depth > seen && !maxDepth.compare_exchange_weak(seen, depth)) {}
+        playouts++;
+    }
+    return playouts;
+}
+
+Evaluation MctsEngine::search(const Board &board, uint64_t msAllowed) {
+    if (!reuseTree(board)) {
+        resetTree(board);
+    }
+    lastReusedVisits = pool[root].visits.load();
+    maxDepth = 0;
+
+    uint64_t deadline = nowNanos() + msAllowed * 1000000;
+    std::vector<std::thread> workers;
+    std::vector<uint64_t> playouts(std::max<uint32_t>(threads, 1), 0);
+    uint64_t seed = nowNanos();
+    for (uint32_t i = 0; i < playouts.size(); i++) {
+        workers.emplace_back([this, i, deadline, seed, &playouts]() {
+            playouts[i] = runPlayouts(deadline, seed + i * 0x9E3779B97F4A7C15llu);
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    lastPlayouts = 0;
+    for (uint64_t count : playouts) {
+        lastPlayouts += count;
+    }
+
+    // The most visited move is the most trusted one; a move that wins on the
+    // spot is taken regardless.
+    const MctsNode &rootNode = pool[root];
+    if (rootNode.state.load() != EXPANDED) {
+        for (int cIdx : COLUMN_ORDER) {
+            if (board.canPlay(cIdx)) {
+                return {0, cIdx, 0, 0};
+            }
+        }
+        return {0, -1, 0, 0};
+    }
+    uint32_t best = rootNode.firstChild;
+    for (uint32_t i = rootNode.firstChild; i < rootNode.firstChild + rootNode.childCount; i++) {
+        if (pool[i].terminal == TERMINAL_WIN) {
+            return {1, pool[i].move, 1, 1};
+        }
+        if (pool[i].visits.load() > pool[best].visits.load()) {
+            best = i;
+        }
+    }
+    return {0, pool[best].move, 0, maxDepth.load()};
+}
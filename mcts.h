@@ -0,0 +1,69 @@
+#ifndef CONNECT_FOUR_MCTS_H
+#define CONNECT_FOUR_MCTS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "connect-four.h"
+
+// Monte Carlo tree search for short time controls. Threads share one tree and
+// steer away from each other's paths with virtual loss. Nodes come from a
+// fixed pool, and the subtree under the position reached two plies later is
+// kept for the next search. Once the pool runs out, leaves stop expanding and
+// the search carries on with playouts from them.
+//
+// Reuse is meant for bullet time controls (tens of milliseconds a move). At
+// play's seconds a move a single search fills most of the pool, so the next
+// one usually starts from a fresh tree.
+
+const uint32_t MCTS_POOL_CAPACITY = 1u << 21u;
+const double MCTS_EXPLORATION = 1.4;
+const int32_t MCTS_VIRTUAL_LOSS = 3;
+
+struct MctsNode {
+    // Rewards are in half points (win 2, draw 1, loss 0) for the side that
+    // played the move into this node.
+    std::atomic<int32_t> visits;
+    std::atomic<int32_t> reward;
+    std::atomic<uint8_t> state;
+    uint8_t move;
+    uint8_t childCount;
+    int8_t terminal;
+    uint32_t firstChild;
+};
+
+class MctsEngine {
+public:
+    MctsEngine(uint32_t threads, uint32_t poolCapacity);
+    explicit MctsEngine(uint32_t threads);
+
+    MctsEngine(const MctsEngine &rhs) = delete;
+    MctsEngine& operator=(const MctsEngine &rhs) = delete;
+
+    Evaluation search(const Board &board, uint64_t msAllowed);
+
+    uint64_t lastPlayouts = 0;
+    uint32_t lastReusedVisits = 0;
+
+private:
+    uint32_t threads;
+    uint32_t poolCapacity;
+    std::unique_ptr<MctsNode[]> pool;
+    std::atomic<uint32_t> poolSize;
+    std::atomic<bool> poolFull;
+    std::atomic<uint32_t> maxDepth;
+
+    uint32_t root = 0;
+    Board rootBoard;
+    bool hasTree = false;
+
+    uint32_t allocNodes(uint32_t count);
+    void resetTree(const Board &board);
+    bool reuseTree(const Board &board);
+    bool expand(MctsNode &node, uint64_t piecesTurn, uint64_t piecesOther);
+    uint32_t select(const MctsNode &node) const;
+    uint64_t runPlayouts(uint64_t deadlineNanos, uint64_t seed);
+};
+
+#endif //CONNECT_FOUR_MCTS_H
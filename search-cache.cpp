@@ -0,0 +1,270 @@
+#include "search-cache.h"
+#include "tablebase.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const char CACHE_MAGIC[8] = {'C', '4', 'C', 'A', 'C', 'H', 'E', '\0'};
+static const uint64_t CACHE_EMPTY = (uint64_t)1u << 63u;
+static const uint32_t CACHE_EVICTION_WINDOW = 8;
+
+static uint64_t roundUpPow2(uint64_t n) {
+    uint64_t ret = 1;
+    while (ret < n) {
+        ret <<= 1u;
+    }
+    return ret;
+}
+
+static uint64_t recordIdx(uint64_t piecesTurn, uint64_t piecesOther, uint64_t capacity) {
+    uint64_t h = piecesTurn * 0x9E3779B97F4A7C15llu ^ piecesOther * 0xC2B2AE3D27D4EB4Fllu;
+    return (h ^ (h >> 29u)) & (capacity - 1);
+}
+
+static CacheRecord emptyRecord() {
+    CacheRecord rec{};
+    rec.piecesTurn = CACHE_EMPTY;
+    return rec;
+}
+
+static const CacheRecord* findRecord(const CacheRecord* table, uint64_t capacity, uint64_t piecesTurn, uint64_t piecesOther) {
+    if (capacity == 0) {
+        return nullptr;
+    }
+    uint64_t idx = recordIdx(piecesTurn, piecesOther, capacity);
+    while (true) {
+        const CacheRecord &rec = table[idx];
+        if (rec.piecesTurn == CACHE_EMPTY) {
+            return nullptr;
+        } else if (rec.piecesTurn == piecesTurn && rec.piecesOther == piecesOther) {
+            return &rec;
+        }
+        idx = (idx + 1) & (capacity - 1);
+    }
+}
+
+// Deeper results replace shallower ones, and nothing replaces an exact one.
+static bool supersedes(const CacheRecord &rec, const CacheRecord &old) {
+    if (old.exact) {
+        return false;
+    }
+    return rec.exact || rec.depth > old.depth;
+}
+
+// How much an entry is worth keeping once the table is full: deeper searches
+// cost more to redo, and an exact result beats one of the same depth.
+static uint32_t recordValue(const CacheRecord &rec) {
+    return rec.depth * 2u + rec.exact;
+}
+
+static bool valuedAbove(const CacheRecord &lhs, const CacheRecord &rhs) {
+    return recordValue(lhs) > recordValue(rhs);
+}
+
+// When the table is full, a new key takes the slot of the least valuable
+// entry among the first few it probes past, if it is worth more.
+// Returns false when it is not.
+static bool insertRecord(CacheRecord* table, uint64_t capacity, uint64_t &count, const CacheRecord &rec) {
+    uint64_t idx = recordIdx(rec.piecesTurn, rec.piecesOther, capacity);
+    CacheRecord* weakest = nullptr;
+    for (uint32_t probes = 0; ; probes++) {
+        CacheRecord &slot = table[idx];
+        if (slot.piecesTurn == CACHE_EMPTY) {
+            if ((count + 1) * 4 <= capacity * 3) {
+                slot = rec;
+                count++;
+                return true;
+            }
+            if (weakest != nullptr && valuedAbove(rec, *weakest)) {
+                *weakest = rec;
+                return true;
+            }
+            return false;
+        } else if (slot.piecesTurn == rec.piecesTurn && slot.piecesOther == rec.piecesOther) {
+            if (supersedes(rec, slot)) {
+                slot = rec;
+            }
+            return true;
+        }
+        if (probes < CACHE_EVICTION_WINDOW && (weakest == nullptr || valuedAbove(*weakest, slot))) {
+            weakest = &slot;
+        }
+        idx = (idx + 1) & (capacity - 1);
+    }
+}
+
+static uint64_t checksumRecords(const CacheRecord* table, uint64_t capacity) {
+    return checksumBytes(CHECKSUM_SEED, table, capacity * sizeof(CacheRecord));
+}
+
+SearchCache::SearchCache(uint64_t capacity, SnapshotPolicy policy)
+    : policy(policy), records(roundUpPow2(capacity), emptyRecord()) {}
+
+SearchCache::SearchCache(uint64_t capacity) : SearchCache(capacity, SnapshotPolicy()) {}
+
+SearchCache::~SearchCache() {
+    unmap();
+}
+
+bool SearchCache::keeps(const CacheRecord &rec) const {
+    return (policy.keepExact && rec.exact) || rec.depth >= policy.minDepth;
+}
+
+// Converts an exact result to what a search to depthRem would report.
+static EvaluationPart atDepth(int score, uint32_t winIn, int depthRem) {
+    // A forced result is only visible to a search that reaches it, and a
+    // search that sees nothing forced always reports winIn == depthRem.
+    if (score != 0 && (int)winIn <= depthRem) {
+        return EvaluationPart(score, winIn);
+    }
+    return EvaluationPart(0, depthRem);
+}
+
+bool SearchCache::probe(uint64_t piecesTurn, uint64_t piecesOther, int depthRem, EvaluationPart &out) {
+    // A subtree with less than minDepth to go costs less to search again
+    // than the cache miss of looking it up.
+    if (depthRem < (int)policy.minDepth) {
+        return false;
+    }
+    const CacheRecord* found[] = {
+        findRecord(records.data(), records.size(), piecesTurn, piecesOther),
+        findRecord(mapped, mappedCapacity, piecesTurn, piecesOther),
+    };
+
+    for (const CacheRecord* rec : found) {
+        if (rec == nullptr) {
+            continue;
+        }
+        if (rec->score != 0 || rec->exact || rec->depth >= depthRem) {
+            out = atDepth(rec->score, rec->winIn, depthRem);
+            hits++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SearchCache::probeTablebase(uint64_t piecesTurn, uint64_t piecesOther, int depthRem, EvaluationPart &out) {
+    EvaluationPart exact;
+    if (tablebase == nullptr || !tablebase->probe(piecesTurn, piecesOther, exact)) {
+        return false;
+    }
+    out = atDepth(exact.score, exact.winIn, depthRem);
+    tablebaseHits++;
+    return true;
+}
+
+void SearchCache::attachTablebase(const Tablebase *tablebase) {
+    this->tablebase = tablebase;
+    tablebaseMinPieces = tablebase != nullptr ? 42 - tablebase->maxEmpty() : 0;
+}
+
+void SearchCache::record(uint64_t piecesTurn, uint64_t piecesOther, const EvaluationPart &part, int depthRem) {
+    CacheRecord rec{};
+    rec.piecesTurn = piecesTurn;
+    rec.piecesOther = piecesOther;
+    rec.score = part.score;
+    rec.winIn = part.winIn;
+    rec.depth = depthRem;
+    rec.exact = part.score != 0 || depthRem >= 42 - __builtin_popcountll(piecesTurn | piecesOther);
+
+    if (!keeps(rec)) {
+        return;
+    }
+    if (insertRecord(records.data(), records.size(), recordCount, rec)) {
+        inserts++;
+    } else {
+        failedInserts++;
+    }
+}
+
+bool SearchCache::load(const std::string &path) {
+    unmap();
+    if (!file.map(path) || file.size() < sizeof(CacheFileHeader)) {
+        file.unmap();
+        return false;
+    }
+
+    auto header = reinterpret_cast<const CacheFileHeader*>(file.data());
+    auto table = reinterpret_cast<const CacheRecord*>(file.data() + sizeof(CacheFileHeader));
+    bool valid = std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+        header->version == SEARCH_CACHE_VERSION &&
+        header->recordSize == sizeof(CacheRecord) &&
+        header->capacity != 0 && (header->capacity & (header->capacity - 1)) == 0 &&
+        header->count < header->capacity &&
+        // Divide first, so a huge capacity cannot wrap the size check.
+        header->capacity <= (file.size() - sizeof(CacheFileHeader)) / sizeof(CacheRecord) &&
+        (uint64_t)file.size() == sizeof(CacheFileHeader) + header->capacity * sizeof(CacheRecord) &&
+        checksumRecords(table, header->capacity) == header->checksum;
+
+    if (!valid) {
+        file.unmap();
+        return false;
+    }
+
+    mapped = table;
+    mappedCapacity = header->capacity;
+    mappedCount = header->count;
+    return true;
+}
+
+bool SearchCache::save(const std::string &path) const {
+    std::vector<CacheRecord> merged(roundUpPow2((recordCount + mappedCount) * 2 + 1), emptyRecord());
+    uint64_t mergedCount = 0;
+
+    for (const CacheRecord &rec : records) {
+        if (rec.piecesTurn != CACHE_EMPTY && keeps(rec)) {
+            insertRecord(merged.data(), merged.size(), mergedCount, rec);
+        }
+    }
+    for (uint64_t i = 0; i < mappedCapacity; i++) {
+        if (mapped[i].piecesTurn != CACHE_EMPTY && keeps(mapped[i])) {
+            insertRecord(merged.data(), merged.size(), mergedCount, mapped[i]);
+        }
+    }
+
+    // Keep only the most valuable entries, so that saving a loaded snapshot
+    // does not grow the file without bound.
+    std::vector<CacheRecord> kept;
+    kept.reserve(mergedCount);
+    for (const CacheRecord &rec : merged) {
+        if (rec.piecesTurn != CACHE_EMPTY) {
+            kept.push_back(rec);
+        }
+    }
+    std::vector<CacheRecord>().swap(merged);
+    if (kept.size() > policy.maxEntries) {
+        std::nth_element(kept.begin(), kept.begin() + policy.maxEntries, kept.end(), valuedAbove);
+        kept.resize(policy.maxEntries);
+    }
+
+    std::vector<CacheRecord> out(roundUpPow2(kept.size() * 2), emptyRecord());
+    uint64_t count = 0;
+    for (const CacheRecord &rec : kept) {
+        insertRecord(out.data(), out.size(), count, rec);
+    }
+
+    CacheFileHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = SEARCH_CACHE_VERSION;
+    header.recordSize = sizeof(CacheRecord);
+    header.capacity = out.size();
+    header.count = count;
+    header.checksum = checksumRecords(out.data(), out.size());
+
+    return writeFileAtomically(path, {
+        {&header, sizeof(header)},
+        {out.data(), out.size() * sizeof(CacheRecord)},
+    });
+}
+
+uint64_t SearchCache::size() const {
+    return recordCount + mappedCount;
+}
+
+void SearchCache::unmap() {
+    file.unmap();
+    mapped = nullptr;
+    mappedCapacity = 0;
+    mappedCount = 0;
+}
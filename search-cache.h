@@ -0,0 +1,101 @@
+#ifndef CONNECT_FOUR_SEARCH_CACHE_H
+#define CONNECT_FOUR_SEARCH_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "connect-four.h"
+#include "mapped-file.h"
+
+class Tablebase;
+
+// Search results that outlive a single Board::evaluate call. Entries are
+// keyed like the per-call MultiHashMap (pieces of the side to move, pieces of
+// the other side) and remember the depth they were searched to, so that a
+// result can be reused by any later search that asks for the same or less.
+//
+// A cache can be snapshotted to disk and mapped back in at startup. The file
+// is the open-addressed table itself, so a loaded snapshot is probed in place.
+
+const uint32_t SEARCH_CACHE_VERSION = 1;
+const uint64_t SEARCH_CACHE_CAPACITY = 1u << 20u;
+
+struct CacheRecord {
+    uint64_t piecesTurn;
+    uint64_t piecesOther;
+    int8_t score;
+    uint8_t winIn;
+    uint8_t depth;
+    uint8_t exact;
+    uint32_t reserved;
+};
+
+struct CacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t checksum;
+};
+
+// Which entries are worth keeping. Exact entries (proven wins, losses and
+// draws) are valid at every depth; the rest only answer searches that are no
+// deeper than they were. A snapshot holds at most maxEntries of them, the
+// deepest first.
+struct SnapshotPolicy {
+    uint32_t minDepth = 8;
+    bool keepExact = true;
+    uint64_t maxEntries = SEARCH_CACHE_CAPACITY / 2;
+};
+
+class SearchCache {
+public:
+    explicit SearchCache(uint64_t capacity, SnapshotPolicy policy);
+    explicit SearchCache(uint64_t capacity);
+    ~SearchCache();
+
+    SearchCache(const SearchCache &rhs) = delete;
+    SearchCache& operator=(const SearchCache &rhs) = delete;
+
+    bool probe(uint64_t piecesTurn, uint64_t piecesOther, int depthRem, EvaluationPart &out);
+    bool probeTablebase(uint64_t piecesTurn, uint64_t piecesOther, int depthRem, EvaluationPart &out);
+    void record(uint64_t piecesTurn, uint64_t piecesOther, const EvaluationPart &part, int depthRem);
+
+    // Attach a tablebase once it is built or loaded; its range is read here.
+    void attachTablebase(const Tablebase *tablebase);
+    // Cheap enough to ask at every node before probeTablebase.
+    bool inTablebaseRange(uint64_t combinedPieces) const {
+        return tablebase != nullptr && __builtin_popcountll(combinedPieces) >= (int)tablebaseMinPieces;
+    }
+
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+
+    uint64_t size() const;
+
+    uint64_t hits = 0;
+    uint64_t tablebaseHits = 0;
+    uint64_t inserts = 0;
+    uint64_t failedInserts = 0;
+
+private:
+    SnapshotPolicy policy;
+    const Tablebase* tablebase = nullptr;
+    uint32_t tablebaseMinPieces = 0;
+
+    std::vector<CacheRecord> records;
+    uint64_t recordCount = 0;
+
+    const CacheRecord* mapped = nullptr;
+    uint64_t mappedCapacity = 0;
+    uint64_t mappedCount = 0;
+    MappedFile file;
+
+    bool keeps(const CacheRecord &rec) const;
+    void unmap();
+};
+
+#endif //CONNECT_FOUR_SEARCH_CACHE_H
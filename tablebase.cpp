@@ -0,0 +1,254 @@
+#include "tablebase.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+static const char TABLEBASE_MAGIC[8] = {'C', '4', 'T', 'B', 'A', 'S', 'E', '\0'};
+
+// Seven bits per column: the side to move's pieces in the filled cells, with
+// a marker bit just above them, which is enough to tell every position apart.
+static uint64_t positionKey(uint64_t piecesTurn, uint64_t piecesOther) {
+    uint64_t key = 0;
+    for (uint32_t cIdx = 0; cIdx < 7; cIdx++) {
+        uint64_t turnCol = (piecesTurn >> (cIdx * 6)) & 0x3Fu;
+        uint32_t height = __builtin_popcountll((piecesTurn | piecesOther) >> (cIdx * 6) & 0x3Fu);
+        uint64_t field = (turnCol >> (6 - height)) | (1u << height);
+        key |= field << (cIdx * 7);
+    }
+    return key;
+}
+
+static void piecesForKey(uint64_t key, uint64_t &piecesTurn, uint64_t &piecesOther) {
+    piecesTurn = 0;
+    piecesOther = 0;
+    for (uint32_t cIdx = 0; cIdx < 7; cIdx++) {
+        uint64_t field = (key >> (cIdx * 7)) & 0x7Fu;
+        uint32_t height = 63 - __builtin_clzll(field);
+        uint64_t filled = (((uint64_t)1u << height) - 1) << (6 - height);
+        uint64_t turnCol = (field & (((uint64_t)1u << height) - 1)) << (6 - height);
+        piecesTurn |= turnCol << (cIdx * 6);
+        piecesOther |= (filled & ~turnCol) << (cIdx * 6);
+    }
+}
+
+static uint8_t packValue(const EvaluationPart &part) {
+    return (uint8_t)((part.score + 1) | (part.winIn << 2u));
+}
+
+static EvaluationPart unpackValue(uint8_t value) {
+    return {(int)(value & 0x3u) - 1, (uint32_t)(value >> 2u)};
+}
+
+static uint64_t checksumTable(const uint64_t* keys, const uint8_t* values, uint64_t count) {
+    uint64_t hash = checksumBytes(CHECKSUM_SEED, keys, count * sizeof(uint64_t));
+    return checksumBytes(hash, values, count);
+}
+
+static void parallelFor(uint64_t count, uint32_t threads, const std::function<void(uint64_t, uint64_t, uint32_t)> &body) {
+    threads = std::max<uint32_t>(threads, 1);
+    uint64_t chunk = (count + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++) {
+        uint64_t begin = std::min(count, t * chunk);
+        uint64_t end = std::min(count, begin + chunk);
+        workers.emplace_back(body, begin, end, t);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+Tablebase::~Tablebase() {
+    unmap();
+}
+
+void Tablebase::generate(const std::vector<Board> &seeds, uint32_t maxEmpty, uint32_t threads) {
+    unmap();
+    maxEmpty = std::min<uint32_t>(maxEmpty, 42);
+    maxEmptyCells = maxEmpty;
+
+    // layers[e] holds the sorted keys of the positions with e empty squares.
+    std::vector<std::vector<uint64_t>> layers(43);
+    uint32_t topEmpty = 0;
+    for (const Board &seed : seeds) {
+        uint32_t empty = 42 - seed.turnCount();
+        uint64_t piecesTurn = seed.isP1Turn() ? seed.pieces[0] : seed.pieces[1];
+        uint64_t piecesOther = seed.isP1Turn() ? seed.pieces[1] : seed.pieces[0];
+        layers[empty].push_back(positionKey(piecesTurn, piecesOther));
+        topEmpty = std::max(topEmpty, empty);
+    }
+
+    for (uint32_t empty = topEmpty; empty > 0; empty--) {
+        std::vector<uint64_t> &layer = layers[empty];
+        std::sort(layer.begin(), layer.end());
+        layer.erase(std::unique(layer.begin(), layer.end()), layer.end());
+
+        // Positions after a winning move are over and are not stored.
+        std::vector<std::vector<uint64_t>> children(std::max<uint32_t>(threads, 1));
+        parallelFor(layer.size(), threads, [&](uint64_t begin, uint64_t end, uint32_t t) {
+            for (uint64_t i = begin; i < end; i++) {
+                uint64_t piecesTurn, piecesOther;
+                piecesForKey(layer[i], piecesTurn, piecesOther);
+                uint64_t combinedPieces = piecesTurn | piecesOther;
+                uint64_t playable = playableMask(combinedPieces) & ~threatMask(piecesTurn, combinedPieces);
+                while (playable != 0) {
+                    uint64_t move = playable & -playable;
+                    playable ^= move;
+                    children[t].push_back(positionKey(piecesOther, piecesTurn | move));
+                }
+            }
+        });
+        for (const auto &local : children) {
+            layers[empty - 1].insert(layers[empty - 1].end(), local.begin(), local.end());
+        }
+        if (empty > maxEmpty) {
+            std::vector<uint64_t>().swap(layer);
+        }
+    }
+    std::sort(layers[0].begin(), layers[0].end());
+    layers[0].erase(std::unique(layers[0].begin(), layers[0].end()), layers[0].end());
+
+    std::vector<std::vector<uint8_t>> layerValues(maxEmpty + 1);
+    layerValues[0].assign(layers[0].size(), packValue(EvaluationPart(0, 0)));
+
+    for (uint32_t empty = 1; empty <= maxEmpty; empty++) {
+        const std::vector<uint64_t> &layer = layers[empty];
+        const std::vector<uint64_t> &below = layers[empty - 1];
+        const std::vector<uint8_t> &belowValues = layerValues[empty - 1];
+        std::vector<uint8_t> &values = layerValues[empty];
+        values.resize(layer.size());
+
+        parallelFor(layer.size(), threads, [&](uint64_t begin, uint64_t end, uint32_t) {
+            for (uint64_t i = begin; i < end; i++) {
+                uint64_t piecesTurn, piecesOther;
+                piecesForKey(layer[i], piecesTurn, piecesOther);
+                uint64_t combinedPieces = piecesTurn | piecesOther;
+                uint64_t playable = playableMask(combinedPieces);
+
+                EvaluationPart best(-2, 0);
+                if (threatMask(piecesTurn, combinedPieces) & playable) {
+                    best = EvaluationPart(1, 1);
+                    playable = 0;
+                }
+                while (playable != 0) {
+                    uint64_t move = playable & -playable;
+                    playable ^= move;
+                    uint64_t childKey = positionKey(piecesOther, piecesTurn | move);
+                    auto it = std::lower_bound(below.begin(), below.end(), childKey);
+                    EvaluationPart res = unpackValue(belowValues[it - below.begin()]);
+                    res.winIn++;
+                    res.score *= -1;
+                    if (isBetter(res, best)) {
+                        best = res;
+                    }
+                }
+                values[i] = packValue(best);
+            }
+        });
+    }
+
+    std::vector<std::pair<uint64_t, uint8_t>> entries;
+    for (uint32_t empty = 0; empty <= maxEmpty; empty++) {
+        for (uint64_t i = 0; i < layers[empty].size(); i++) {
+            entries.emplace_back(layers[empty][i], layerValues[empty][i]);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+
+    ownedKeys.resize(entries.size());
+    ownedValues.resize(entries.size());
+    for (uint64_t i = 0; i < entries.size(); i++) {
+        ownedKeys[i] = entries[i].first;
+        ownedValues[i] = entries[i].second;
+    }
+    keys = ownedKeys.data();
+    values = ownedValues.data();
+    count = entries.size();
+}
+
+bool Tablebase::probe(uint64_t piecesTurn, uint64_t piecesOther, EvaluationPart &out) const {
+    if (count == 0 || 42 - __builtin_popcountll(piecesTurn | piecesOther) > (int)maxEmptyCells) {
+        return false;
+    }
+    uint64_t key = positionKey(piecesTurn, piecesOther);
+    const uint64_t* it = std::lower_bound(keys, keys + count, key);
+    if (it == keys + count || *it != key) {
+        return false;
+    }
+    out = unpackValue(values[it - keys]);
+    return true;
+}
+
+bool Tablebase::load(const std::string &path) {
+    unmap();
+    if (!file.map(path) || file.size() < sizeof(TablebaseFileHeader)) {
+        file.unmap();
+        return false;
+    }
+
+    auto header = reinterpret_cast<const TablebaseFileHeader*>(file.data());
+    bool valid = std::memcmp(header->magic, TABLEBASE_MAGIC, sizeof(TABLEBASE_MAGIC)) == 0 &&
+        header->version == TABLEBASE_VERSION &&
+        header->maxEmpty <= 42 &&
+        // Divide first, so a huge count cannot wrap the size check.
+        header->count <= (file.size() - sizeof(TablebaseFileHeader)) / (sizeof(uint64_t) + 1) &&
+        (uint64_t)file.size() == sizeof(TablebaseFileHeader) + header->count * (sizeof(uint64_t) + 1);
+
+    auto mappedKeys = reinterpret_cast<const uint64_t*>(file.data() + sizeof(TablebaseFileHeader));
+    auto mappedValues = reinterpret_cast<const uint8_t*>(mappedKeys + (valid ? header->count : 0));
+    if (!valid || checksumTable(mappedKeys, mappedValues, header->count) != header->checksum) {
+        file.unmap();
+        return false;
+    }
+
+    maxEmptyCells = header->maxEmpty;
+    keys = mappedKeys;
+    values = mappedValues;
+    count = header->count;
+    return true;
+}
+
+bool Tablebase::save(const std::string &path) const {
+    TablebaseFileHeader header{};
+    std::memcpy(header.magic, TABLEBASE_MAGIC, sizeof(TABLEBASE_MAGIC));
+    header.version = TABLEBASE_VERSION;
+    header.maxEmpty = maxEmptyCells;
+    header.count = count;
+    header.checksum = checksumTable(keys, values, count);
+
+    return writeFileAtomically(path, {
+        {&header, sizeof(header)},
+        {keys, count * sizeof(uint64_t)},
+        {values, count},
+    });
+}
+
+uint32_t Tablebase::maxEmpty() const {
+    return maxEmptyCells;
+}
+
+uint64_t Tablebase::size() const {
+    return count;
+}
+
+uint64_t Tablebase::keyAt(uint64_t idx) const {
+    return keys[idx];
+}
+
+Board Tablebase::boardForKey(uint64_t key) {
+    uint64_t piecesTurn, piecesOther;
+    piecesForKey(key, piecesTurn, piecesOther);
+    bool p1Turn = __builtin_popcountll(piecesTurn | piecesOther) % 2 == 0;
+    return Board(p1Turn ? std::array<uint64_t, 2>{piecesTurn, piecesOther} : std::array<uint64_t, 2>{piecesOther, piecesTurn});
+}
+
+void Tablebase::unmap() {
+    file.unmap();
+    keys = nullptr;
+    values = nullptr;
+    count = 0;
+    std::vector<uint64_t>().swap(ownedKeys);
+    std::vector<uint8_t>().swap(ownedValues);
+}
@@ -0,0 +1,65 @@
+#ifndef CONNECT_FOUR_TABLEBASE_H
+#define CONNECT_FOUR_TABLEBASE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "connect-four.h"
+#include "mapped-file.h"
+
+// Exact values for every position with at most maxEmpty empty squares that
+// can be reached from a set of seed positions. Positions are solved a layer
+// of empty squares at a time, from the full board up, so each layer only
+// looks up the one below it.
+//
+// The file is a sorted array of position keys followed by one packed value
+// per key, and is mapped in place like a SearchCache snapshot.
+
+const uint32_t TABLEBASE_VERSION = 1;
+
+struct TablebaseFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t maxEmpty;
+    uint64_t count;
+    uint64_t checksum;
+};
+
+class Tablebase {
+public:
+    Tablebase() = default;
+    ~Tablebase();
+
+    Tablebase(const Tablebase &rhs) = delete;
+    Tablebase& operator=(const Tablebase &rhs) = delete;
+
+    void generate(const std::vector<Board> &seeds, uint32_t maxEmpty, uint32_t threads);
+
+    bool probe(uint64_t piecesTurn, uint64_t piecesOther, EvaluationPart &out) const;
+
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+
+    uint32_t maxEmpty() const;
+    uint64_t size() const;
+    uint64_t keyAt(uint64_t idx) const;
+    static Board boardForKey(uint64_t key);
+
+private:
+    uint32_t maxEmptyCells = 0;
+
+    std::vector<uint64_t> ownedKeys;
+    std::vector<uint8_t> ownedValues;
+
+    const uint64_t* keys = nullptr;
+    const uint8_t* values = nullptr;
+    uint64_t count = 0;
+
+    MappedFile file;
+
+    void unmap();
+};
+
+#endif //CONNECT_FOUR_TABLEBASE_H
@@ -0,0 +1,87 @@
+#include "threat-space.h"
+
+static const int COLUMN_ORDER[] = {3, 2, 4, 1, 5, 0, 6};
+
+static int cellCol(uint64_t cell) {
+    return __builtin_ctzll(cell) / 6;
+}
+
+static bool threatSpaceHelper(uint64_t piecesTurn, uint64_t piecesOther, int pliesRem, uint64_t nodeBudget, ThreatSpaceResult &result) {
+    if (result.nodes++ >= nodeBudget) {
+        return false;
+    }
+
+    uint64_t combinedPieces = piecesTurn | piecesOther;
+    uint64_t playable = playableMask(combinedPieces);
+
+    uint64_t wins = threatMask(piecesTurn, combinedPieces) & playable;
+    if (wins != 0) {
+        result.line.push_back(cellCol(wins));
+        return true;
+    }
+    if (pliesRem < 3) {
+        return false;
+    }
+
+    // If the other side threatens to win, the only move is the block, and
+    // two such threats cannot both be blocked.
+    uint64_t losses = threatMask(piecesOther, combinedPieces) & playable;
+    if (__builtin_popcountll(losses) > 1) {
+        return false;
+    }
+    uint64_t candidates = losses != 0 ? losses : playable;
+
+    for (int cIdx : COLUMN_ORDER) {
+        uint64_t move = candidates & ((uint64_t)0x3Fu << (cIdx * 6));
+        if (move == 0) {
+            continue;
+        }
+        uint64_t piecesTurnAfter = piecesTurn | move;
+        uint64_t combinedAfter = combinedPieces | move;
+        uint64_t playableAfter = playableMask(combinedAfter);
+
+        if (threatMask(piecesOther, combinedAfter) & playableAfter) {
+            continue;
+        }
+        uint64_t threats = threatMask(piecesTurnAfter, combinedAfter) & playableAfter;
+        if (threats == 0) {
+            continue;
+        }
+
+        if (__builtin_popcountll(threats) > 1) {
+            uint64_t block = threats & -threats;
+            result.line.push_back(cIdx);
+            result.line.push_back(cellCol(block));
+            result.line.push_back(cellCol(threats ^ block));
+            return true;
+        }
+
+        result.line.push_back(cIdx);
+        result.line.push_back(cellCol(threats));
+        if (threatSpaceHelper(piecesTurnAfter, piecesOther | threats, pliesRem - 2, nodeBudget, result)) {
+            return true;
+        }
+        result.line.pop_back();
+        result.line.pop_back();
+    }
+    return false;
+}
+
+// Deepens two plies at a time so the first win found is the shortest one in
+// threat space.
+ThreatSpaceResult threatSpaceSearch(const Board &board, uint32_t maxPlies, uint64_t nodeBudget) {
+    ThreatSpaceResult result;
+    uint64_t piecesTurn = board.isP1Turn() ? board.pieces[0] : board.pieces[1];
+    uint64_t piecesOther = board.isP1Turn() ? board.pieces[1] : board.pieces[0];
+
+    for (uint32_t plies = 1; plies <= maxPlies && result.nodes < nodeBudget; plies += 2) {
+        result.line.clear();
+        if (threatSpaceHelper(piecesTurn, piecesOther, plies, nodeBudget, result)) {
+            result.proven = true;
+            result.winIn = result.line.size();
+            return result;
+        }
+    }
+    result.line.clear();
+    return result;
+}
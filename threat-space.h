@@ -0,0 +1,23 @@
+#ifndef CONNECT_FOUR_THREAT_SPACE_H
+#define CONNECT_FOUR_THREAT_SPACE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "connect-four.h"
+
+// Threat-space search: the side to move only plays moves that make an
+// immediate threat, so every reply is forced and the tree stays narrow. A
+// proven result is a real forced win, but not always the fastest one, and a
+// failed search proves nothing.
+
+struct ThreatSpaceResult {
+    bool proven = false;
+    uint32_t winIn = 0;
+    std::vector<int> line;
+    uint64_t nodes = 0;
+};
+
+ThreatSpaceResult threatSpaceSearch(const Board &board, uint32_t maxPlies, uint64_t nodeBudget);
+
+#endif //CONNECT_FOUR_THREAT_SPACE_H